@@ -17,6 +17,7 @@
 #include<details/FileIOTypes.hpp>
 #include<details/BaseStructures.hpp>
 #include<details/Matrix4x4.hpp>
+#include<details/HalfEdgeMesh.hpp>
 #include<details/Model.hpp>
 
 #endif // __cplusplus >= 202002L
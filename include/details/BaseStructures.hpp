@@ -57,6 +57,11 @@ struct Face {
     std::vector<FaceVertexIndex> vertices; // Each face can have multiple vertices, each with indices for v, vt, and vn
 };
 
+struct Contour {
+    std::vector<Vertex> points; // The last point connects back to the first one when closed
+    bool closed = true;         // Open contours only come from meshes with holes or non-manifold edges
+};
+
 } // namespace FAConverter
 
 #endif // BASE_STRUCTURES_HPP
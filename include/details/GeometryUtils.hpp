@@ -18,7 +18,7 @@
 
 namespace FAConverter {
 
-std::array<float, 3> calculateNormal(const Vertex& v0, const Vertex& v1, const Vertex& v2) {
+inline std::array<float, 3> calculateNormal(const Vertex& v0, const Vertex& v1, const Vertex& v2) {
     std::array<float, 3> normal;
     float u[3] = {v1.x - v0.x, v1.y - v0.y, v1.z - v0.z};
     float v[3] = {v2.x - v0.x, v2.y - v0.y, v2.z - v0.z};
@@ -38,12 +38,12 @@ std::array<float, 3> calculateNormal(const Vertex& v0, const Vertex& v1, const V
     return normal;
 }
 
-Vertex normalize(const Vertex& v) {
+inline Vertex normalize(const Vertex& v) {
     float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
     return {v.x / length, v.y / length, v.z / length};
 }
 
-bool rayIntersectsTriangle(const Vertex& ray_origin, const Vertex& ray_vector, const Vertex& a, const Vertex& b, const Vertex& c) {
+inline bool rayIntersectsTriangle(const Vertex& ray_origin, const Vertex& ray_vector, const Vertex& a, const Vertex& b, const Vertex& c) {
     constexpr float epsilon = std::numeric_limits<float>::epsilon();
 
     Vertex edge1 = b - a;
@@ -72,7 +72,7 @@ bool rayIntersectsTriangle(const Vertex& ray_origin, const Vertex& ray_vector, c
     return t > epsilon;
 }
 
-float triangleArea(const Vertex& v0, const Vertex& v1, const Vertex& v2) {
+inline float triangleArea(const Vertex& v0, const Vertex& v1, const Vertex& v2) {
     Vertex edge1 = v1 - v0;
     Vertex edge2 = v2 - v0;
     Vertex crossProduct = edge1.crossProduct(edge2);
@@ -92,7 +92,7 @@ float triangleArea(const Vertex& v0, const Vertex& v1, const Vertex& v2) {
     if my understanding is correct this should apply:
     https://stackoverflow.com/questions/1406029/how-to-calculate-the-volume-of-a-3d-mesh-object-the-surface-of-which-is-made-up
 */
-float tetrahedronVolume(const Vertex& v0, const Vertex& v1, const Vertex& v2) {
+inline float tetrahedronVolume(const Vertex& v0, const Vertex& v1, const Vertex& v2) {
     return v0.dotProduct(v1.crossProduct(v2)) / 6.0f;
 }
 
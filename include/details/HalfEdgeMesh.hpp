@@ -0,0 +1,246 @@
+/**
+ * @file HalfEdgeMesh.hpp
+ * @author F. Abrignani (federignoli@hotmail.it)
+ * @brief Compact half-edge adjacency for the FAConverter library.
+ * @version 0.1
+ * @date 2024-07-06
+ * @private
+ * @copyright Copyright (c) 2024 Federico Abrignani (federignoli@hotmail.it).
+ *
+ */
+
+#ifndef HALF_EDGE_MESH_HPP
+#define HALF_EDGE_MESH_HPP
+
+#include "Parallel.hpp"
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace FAConverter {
+
+/*
+    Half-edges are stored face by face: the half-edges of face f are [faceOffsets[f], faceOffsets[f + 1])
+    and half-edge h goes from origin(h) to the origin of the following half-edge of the same face.
+    Because of this layout next, prev and target need no storage, only origins, owning faces and
+    opposites are kept, 12 bytes per half-edge plus 4 per face and 4 per vertex.
+
+    opposite(h) is either a half-edge index or one of two markers:
+    BOUNDARY when no other face uses the edge and NON_MANIFOLD when the edge is used by more than
+    two half-edges, by two with the same orientation or twice by the same face (a 2-vertex face
+    or a face going back over one of its edges).
+*/
+class HalfEdgeMesh {
+public:
+    static constexpr uint32_t BOUNDARY = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t NON_MANIFOLD = std::numeric_limits<uint32_t>::max() - 1;
+
+    HalfEdgeMesh() = default;
+    HalfEdgeMesh(size_t vertexCount, std::vector<uint32_t> faceOffsets, std::vector<uint32_t> origins);
+
+    size_t vertexCount() const { return _vertexHalfEdge.size(); }
+    size_t faceCount() const { return _faceOffsets.empty() ? 0 : _faceOffsets.size() - 1; }
+    size_t halfEdgeCount() const { return _origin.size(); }
+
+    uint32_t origin(uint32_t h) const { return _origin[h]; }
+    uint32_t target(uint32_t h) const { return _origin[next(h)]; }
+    uint32_t face(uint32_t h) const { return _face[h]; }
+    uint32_t opposite(uint32_t h) const { return _opposite[h]; }
+    uint32_t faceHalfEdge(uint32_t f) const { return _faceOffsets[f]; }
+    uint32_t vertexHalfEdge(uint32_t v) const { return _vertexHalfEdge[v]; }
+
+    uint32_t next(uint32_t h) const {
+        uint32_t f = _face[h];
+        return h + 1 == _faceOffsets[f + 1] ? _faceOffsets[f] : h + 1;
+    }
+
+    uint32_t prev(uint32_t h) const {
+        uint32_t f = _face[h];
+        return h == _faceOffsets[f] ? _faceOffsets[f + 1] - 1 : h - 1;
+    }
+
+    bool isBoundary(uint32_t h) const { return _opposite[h] == BOUNDARY; }
+    bool hasOpposite(uint32_t h) const { return _opposite[h] < NON_MANIFOLD; }
+
+    const std::vector<uint32_t>& nonManifoldEdges() const { return _nonManifoldEdges; }
+    size_t boundaryHalfEdgeCount() const { return _boundaryHalfEdgeCount; }
+    bool isWatertight() const { return _boundaryHalfEdgeCount == 0 && _nonManifoldEdges.empty(); }
+
+    std::vector<uint32_t> vertexOneRing(uint32_t v) const;
+    std::vector<std::vector<uint32_t>> boundaryLoops() const;
+
+private:
+
+    std::vector<uint32_t> _faceOffsets;
+    std::vector<uint32_t> _origin;
+    std::vector<uint32_t> _face;
+    std::vector<uint32_t> _opposite;
+    std::vector<uint32_t> _vertexHalfEdge;
+    std::vector<uint32_t> _nonManifoldEdges; // one half-edge per non-manifold edge
+    size_t _boundaryHalfEdgeCount = 0;
+
+};
+
+/*
+    Every half-edge gets the key (min vertex, max vertex) of its undirected edge, the keys are sorted in parallel
+    and each run of equal keys is then one edge: a run of two opposite half-edges of different faces is
+    an interior edge, a run of one is a boundary and anything else is non-manifold.
+*/
+inline HalfEdgeMesh::HalfEdgeMesh(size_t vertexCount, std::vector<uint32_t> faceOffsets, std::vector<uint32_t> origins)
+    : _faceOffsets(std::move(faceOffsets)), _origin(std::move(origins)) {
+
+    if (_origin.size() >= NON_MANIFOLD || vertexCount >= NON_MANIFOLD) {
+        throw std::runtime_error("Mesh too large for 32-bit half-edge indices");
+    }
+
+    const uint32_t halfEdges = static_cast<uint32_t>(_origin.size());
+    const size_t faces = faceCount();
+
+    _face.resize(halfEdges);
+    _opposite.assign(halfEdges, BOUNDARY);
+    _vertexHalfEdge.assign(vertexCount, BOUNDARY);
+
+    parallelFor(faces, [&](size_t, size_t begin, size_t end) {
+        for (size_t f = begin; f < end; ++f) {
+            for (uint32_t h = _faceOffsets[f]; h < _faceOffsets[f + 1]; ++h) {
+                _face[h] = static_cast<uint32_t>(f);
+            }
+        }
+    }, 4096);
+
+    struct EdgeKey {
+        uint64_t key;
+        uint32_t halfEdge;
+        bool operator<(const EdgeKey& other) const {
+            return key < other.key || (key == other.key && halfEdge < other.halfEdge);
+        }
+    };
+
+    std::vector<EdgeKey> keys(halfEdges);
+    parallelFor(halfEdges, [&](size_t, size_t begin, size_t end) {
+        for (size_t h = begin; h < end; ++h) {
+            uint64_t a = _origin[h];
+            uint64_t b = target(static_cast<uint32_t>(h));
+            keys[h] = {a < b ? (a << 32 | b) : (b << 32 | a), static_cast<uint32_t>(h)};
+        }
+    }, 4096);
+
+    parallelSort(keys);
+
+    // Each worker handles the runs starting inside its chunk
+    const size_t workers = workerCount();
+    std::vector<std::vector<uint32_t>> nonManifold(workers);
+    std::vector<size_t> boundaryCount(workers, 0);
+    parallelFor(keys.size(), [&](size_t worker, size_t begin, size_t end) {
+        size_t i = begin;
+        while (i > 0 && i < end && keys[i].key == keys[i - 1].key) {
+            ++i;
+        }
+        while (i < end) {
+            size_t j = i + 1;
+            while (j < keys.size() && keys[j].key == keys[i].key) {
+                ++j;
+            }
+
+            uint32_t h0 = keys[i].halfEdge;
+            if (j - i == 1) {
+                ++boundaryCount[worker];
+            } else if (j - i == 2 && _origin[h0] != _origin[keys[i + 1].halfEdge]
+                       && _face[h0] != _face[keys[i + 1].halfEdge]) {
+                uint32_t h1 = keys[i + 1].halfEdge;
+                _opposite[h0] = h1;
+                _opposite[h1] = h0;
+            } else {
+                for (size_t k = i; k < j; ++k) {
+                    _opposite[keys[k].halfEdge] = NON_MANIFOLD;
+                }
+                nonManifold[worker].push_back(h0);
+            }
+            i = j;
+        }
+    }, 4096, workers);
+
+    for (size_t w = 0; w < nonManifold.size(); ++w) {
+        _nonManifoldEdges.insert(_nonManifoldEdges.end(), nonManifold[w].begin(), nonManifold[w].end());
+        _boundaryHalfEdgeCount += boundaryCount[w];
+    }
+
+    // Prefer boundary half-edges so the one-ring walk of a boundary vertex starts at one end of its fan
+    for (uint32_t h = 0; h < halfEdges; ++h) {
+        uint32_t& vh = _vertexHalfEdge[_origin[h]];
+        if (vh == BOUNDARY || (!hasOpposite(h) && hasOpposite(vh))) {
+            vh = h;
+        }
+    }
+}
+
+/*
+    Neighbours of v in fan order. The walk first goes backwards to the first outgoing half-edge of the fan
+    (or all the way around for an interior vertex) then forward collecting targets.
+    For a vertex where several fans meet only the fan of vertexHalfEdge(v) is visited.
+*/
+inline std::vector<uint32_t> HalfEdgeMesh::vertexOneRing(uint32_t v) const {
+    std::vector<uint32_t> ring;
+    uint32_t start = _vertexHalfEdge[v];
+    if (start == BOUNDARY) {
+        return ring;
+    }
+
+    uint32_t first = start;
+    while (hasOpposite(first) && next(_opposite[first]) != start) {
+        first = next(_opposite[first]);
+    }
+
+    uint32_t h = first;
+    while (true) {
+        ring.push_back(target(h));
+        uint32_t incoming = prev(h);
+        if (!hasOpposite(incoming)) {
+            ring.push_back(_origin[incoming]);
+            break;
+        }
+        h = _opposite[incoming];
+        if (h == first) {
+            break;
+        }
+    }
+
+    return ring;
+}
+
+/*
+    Chains of boundary half-edges, each returned as the list of its half-edges in order.
+    Loops touching a non-manifold edge cannot be closed and are returned as open chains.
+*/
+inline std::vector<std::vector<uint32_t>> HalfEdgeMesh::boundaryLoops() const {
+    std::vector<std::vector<uint32_t>> loops;
+    std::vector<bool> visited(_origin.size(), false);
+
+    for (uint32_t start = 0; start < _origin.size(); ++start) {
+        if (!isBoundary(start) || visited[start]) {
+            continue;
+        }
+
+        std::vector<uint32_t> loop;
+        uint32_t h = start;
+        while (isBoundary(h) && !visited[h]) {
+            visited[h] = true;
+            loop.push_back(h);
+
+            // rotate around the target vertex until the outgoing half-edge without opposite
+            h = next(h);
+            while (hasOpposite(h)) {
+                h = next(_opposite[h]);
+            }
+        }
+        loops.push_back(std::move(loop));
+    }
+
+    return loops;
+}
+
+} // namespace FAConverter
+
+#endif // HALF_EDGE_MESH_HPP
@@ -103,6 +103,10 @@ public:
         return result;
     }
 
+    float operator()(int row, int col) const {
+        return _m[row][col];
+    }
+
 private:
     std::array<std::array<float, 4>, 4> _m;
 };
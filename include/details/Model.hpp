@@ -13,7 +13,9 @@
 #define MODEL_HPP
 
 #include "FileIOTypes.hpp"
+#include "Matrix4x4.hpp"
 #include <string>
+#include <vector>
 
 namespace FAConverter {
 
@@ -28,6 +30,8 @@ public:
     void read(const std::string& filename);
     template<FileType U>
     void write(const std::string& filename) const;
+    template<FileType U>
+    void writeInstanced(const std::string& filename, const std::vector<Matrix4x4>& instances) const;
 };
 
 } // namespace FAConverter
@@ -16,10 +16,17 @@
 #include "BaseStructures.hpp"
 #include "GeometryUtils.hpp"
 #include "Matrix4x4.hpp"
+#include "Parallel.hpp"
+#include "HalfEdgeMesh.hpp"
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
 #include <cmath>
 #include <limits>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
 
 namespace FAConverter {
 
@@ -33,13 +40,19 @@ public:
     void read(const std::string& filename);
     template<FileType U>
     void write(const std::string& filename) const;
+    template<FileType U>
+    void writeInstanced(const std::string& filename, const std::vector<Matrix4x4>& instances) const;
     void applyTransform(const Matrix4x4& transform);
     bool isPointInside(const Vertex& point) const;
     float calculateSurfaceArea() const;
     float calculateVolume() const;
+    HalfEdgeMesh buildHalfEdgeMesh() const;
+    std::vector<std::vector<Contour>> slice(const std::vector<float>& heights) const;
 
 private:
 
+    std::vector<uint32_t> triangleCorners() const;
+
     std::vector<Vertex> vertices;
     std::vector<TextureVertex> textureVertices;
     std::vector<VertexNormal> vertexNormals;
@@ -47,8 +60,21 @@ private:
 
 };
 
+// Fan triangulation of every face, 3 zero-based vertex indices per triangle
+inline std::vector<uint32_t> Model<FileType::OBJ>::triangleCorners() const {
+    std::vector<uint32_t> corners;
+    for (const auto& face : faces) {
+        for (size_t i = 1; i < face.vertices.size() - 1; ++i) {
+            corners.push_back(face.vertices[0].vertexIndex - 1);
+            corners.push_back(face.vertices[i].vertexIndex - 1);
+            corners.push_back(face.vertices[i + 1].vertexIndex - 1);
+        }
+    }
+    return corners;
+}
+
 // Implementation for reading OBJ files
-void Model<FileType::OBJ>::read(const std::string& filename) {
+inline void Model<FileType::OBJ>::read(const std::string& filename) {
     std::ifstream file(filename);
     if (!file.is_open()) {
         throw std::runtime_error("Could not open file");
@@ -109,7 +135,7 @@ void Model<FileType::OBJ>::read(const std::string& filename) {
 }
 
 template<>
-void Model<FileType::OBJ>::write<FileType::STL>(const std::string& filename) const {
+inline void Model<FileType::OBJ>::write<FileType::STL>(const std::string& filename) const {
     std::ofstream file(filename, std::ios::binary);
     if (!file.is_open()) {
         throw std::runtime_error("Could not open file for writing");
@@ -156,7 +182,148 @@ void Model<FileType::OBJ>::write<FileType::STL>(const std::string& filename) con
     file.close();
 }
 
-void Model<FileType::OBJ>::applyTransform(const Matrix4x4& transform) {
+/*
+    Writes every instance of the model in a single binary STL without copying or transforming the model itself.
+    The output is split in blocks of facesPerBlock consecutive faces of the instances laid one after the other,
+    so a block of a small model holds many instances. Each round the workers fill a fixed number of consecutive
+    blocks into reusable record buffers which are then flushed in order, so memory only depends on the worker
+    count and the block size, not on the model size nor on the number of instances, and a single large instance
+    still uses every worker.
+    Triangles are handled in fixed size sub-blocks laid out as structure of arrays so the transform and the
+    normal computation are plain loops the compiler can vectorize.
+    Normals are always recomputed from the transformed triangle, provided vertex normals are ignored
+    since they would need the inverse transpose of every instance to stay correct.
+*/
+template<>
+inline void Model<FileType::OBJ>::writeInstanced<FileType::STL>(const std::string& filename, const std::vector<Matrix4x4>& instances) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file for writing");
+    }
+
+    uint64_t trianglesPerInstance = 0;
+    for (const auto& face : faces) {
+        trianglesPerInstance += face.vertices.size() - 2;
+    }
+
+    uint64_t totalTriangles = trianglesPerInstance * instances.size();
+    if (totalTriangles > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Too many triangles for a binary STL file");
+    }
+
+    char header[80] = {};
+    file.write(header, 80);
+
+    uint32_t numTriangles = static_cast<uint32_t>(totalTriangles);
+    file.write(reinterpret_cast<const char*>(&numTriangles), sizeof(numTriangles));
+
+    constexpr size_t recordSize = 50; // normal + 3 vertices + attribute byte count
+    constexpr size_t subBlockSize = 64;
+    constexpr size_t facesPerBlock = 4096;
+    constexpr size_t blocksPerWorker = 4;
+
+    const uint64_t totalFaces = static_cast<uint64_t>(faces.size()) * instances.size();
+    const uint64_t totalBlocks = (totalFaces + facesPerBlock - 1) / facesPerBlock;
+
+    struct Block {
+        std::vector<uint32_t> corners;
+        std::vector<char> records;
+    };
+    std::vector<Block> blocks(std::min<uint64_t>(workerCount() * blocksPerWorker, totalBlocks));
+
+    // Appends the records of faces [firstFace, lastFace) of one instance to the block
+    auto fillFaces = [&](const Matrix4x4& m, size_t firstFace, size_t lastFace, Block& block) {
+        block.corners.clear();
+        for (size_t f = firstFace; f < lastFace; ++f) {
+            const auto& face = faces[f];
+            for (size_t i = 1; i < face.vertices.size() - 1; ++i) {
+                block.corners.push_back(face.vertices[0].vertexIndex - 1);
+                block.corners.push_back(face.vertices[i].vertexIndex - 1);
+                block.corners.push_back(face.vertices[i + 1].vertexIndex - 1);
+            }
+        }
+        const size_t triangles = block.corners.size() / 3;
+        const size_t offset = block.records.size();
+        block.records.resize(offset + triangles * recordSize);
+        char* out = block.records.data() + offset;
+
+        const float m00 = m(0, 0), m01 = m(0, 1), m02 = m(0, 2), m03 = m(0, 3);
+        const float m10 = m(1, 0), m11 = m(1, 1), m12 = m(1, 2), m13 = m(1, 3);
+        const float m20 = m(2, 0), m21 = m(2, 1), m22 = m(2, 2), m23 = m(2, 3);
+
+        // p[corner][axis][triangle], n[axis][triangle]
+        float p[3][3][subBlockSize];
+        float n[3][subBlockSize];
+
+        for (size_t first = 0; first < triangles; first += subBlockSize) {
+            const size_t count = std::min(subBlockSize, triangles - first);
+
+            for (size_t c = 0; c < 3; ++c) {
+                for (size_t t = 0; t < count; ++t) {
+                    const Vertex& v = vertices[block.corners[(first + t) * 3 + c]];
+                    p[c][0][t] = m00 * v.x + m01 * v.y + m02 * v.z + m03 * v.w;
+                    p[c][1][t] = m10 * v.x + m11 * v.y + m12 * v.z + m13 * v.w;
+                    p[c][2][t] = m20 * v.x + m21 * v.y + m22 * v.z + m23 * v.w;
+                }
+            }
+
+            for (size_t t = 0; t < count; ++t) {
+                float ux = p[1][0][t] - p[0][0][t], uy = p[1][1][t] - p[0][1][t], uz = p[1][2][t] - p[0][2][t];
+                float vx = p[2][0][t] - p[0][0][t], vy = p[2][1][t] - p[0][1][t], vz = p[2][2][t] - p[0][2][t];
+                float nx = uy * vz - uz * vy;
+                float ny = uz * vx - ux * vz;
+                float nz = ux * vy - uy * vx;
+                float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+                float inv = length != 0.0f ? 1.0f / length : 1.0f;
+                n[0][t] = nx * inv;
+                n[1][t] = ny * inv;
+                n[2][t] = nz * inv;
+            }
+
+            for (size_t t = 0; t < count; ++t) {
+                float record[12] = {
+                    n[0][t], n[1][t], n[2][t],
+                    p[0][0][t], p[0][1][t], p[0][2][t],
+                    p[1][0][t], p[1][1][t], p[1][2][t],
+                    p[2][0][t], p[2][1][t], p[2][2][t]
+                };
+                char* dst = out + (first + t) * recordSize;
+                std::memcpy(dst, record, sizeof(record));
+                std::memset(dst + sizeof(record), 0, sizeof(uint16_t));
+            }
+        }
+    };
+
+    auto fillBlock = [&](uint64_t index, Block& block) {
+        block.records.clear();
+        const uint64_t last = std::min(totalFaces, (index + 1) * facesPerBlock);
+        for (uint64_t face = index * facesPerBlock; face < last;) {
+            const uint64_t instance = face / faces.size();
+            const size_t firstFace = static_cast<size_t>(face % faces.size());
+            const size_t lastFace = static_cast<size_t>(std::min<uint64_t>(faces.size(), firstFace + (last - face)));
+            fillFaces(instances[instance], firstFace, lastFace, block);
+            face += lastFace - firstFace;
+        }
+    };
+
+    for (uint64_t round = 0; round < totalBlocks; round += blocks.size()) {
+        const size_t count = static_cast<size_t>(std::min<uint64_t>(blocks.size(), totalBlocks - round));
+
+        parallelFor(count, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                fillBlock(round + i, blocks[i]);
+            }
+        });
+
+        for (size_t i = 0; i < count; ++i) {
+            file.write(blocks[i].records.data(), blocks[i].records.size());
+        }
+    }
+
+    file.close();
+}
+
+inline void Model<FileType::OBJ>::applyTransform(const Matrix4x4& transform) {
     for (auto& vertex : vertices) {
         vertex = transform * vertex;
     }
@@ -168,7 +335,7 @@ We use the Mller–Trumbore intersection algorithm with some optimizations...
 First since we are going towards the positive x we can ignore all triangles that have a vertex with x coordinate smaller than the point x.
 Second if a triangle intersects the ray we can ignore all other triangles of the current face.
 */
-bool Model<FileType::OBJ>::isPointInside(const Vertex& point) const {
+inline bool Model<FileType::OBJ>::isPointInside(const Vertex& point) const {
     int intersections = 0;
     Vertex ray_vector = {1.0f, 0.0f, 0.0f, 0.0f};
 
@@ -199,7 +366,7 @@ bool Model<FileType::OBJ>::isPointInside(const Vertex& point) const {
     return (intersections % 2) == 1;
 }
 
-float Model<FileType::OBJ>::calculateSurfaceArea() const {
+inline float Model<FileType::OBJ>::calculateSurfaceArea() const {
     float totalArea = 0.0f;
 
     for (const auto& face : faces) {
@@ -215,7 +382,7 @@ float Model<FileType::OBJ>::calculateSurfaceArea() const {
     return totalArea;
 }
 
-float Model<FileType::OBJ>::calculateVolume() const {
+inline float Model<FileType::OBJ>::calculateVolume() const {
     /*float totalVolume = 0.0f;
 
     for (const auto& face : faces) {
@@ -234,6 +401,243 @@ float Model<FileType::OBJ>::calculateVolume() const {
     return 0.0f;
 }
 
+/*
+    Cuts the model with the planes z = heights[i] and returns the contours of each plane, result[i] for heights[i].
+
+    A vertex counts as above the plane when z >= height, so a crossing edge always has one endpoint strictly below
+    and the crossing point only depends on the edge: two triangles sharing an edge produce the same point and
+    the segments can be chained by edge id. Segments are oriented so that, for outward facing triangles,
+    outer contours are counterclockwise and holes clockwise when seen from +z.
+
+    Triangles are sorted by their lowest z and sorted layers are split in contiguous bands, one per worker.
+    Each band sweeps its layers upwards keeping the list of triangles spanning the current height,
+    so a triangle is only intersected with the layers it actually crosses.
+*/
+inline std::vector<std::vector<Contour>> Model<FileType::OBJ>::slice(const std::vector<float>& heights) const {
+    std::vector<std::vector<Contour>> result(heights.size());
+
+    const std::vector<uint32_t> corners = triangleCorners();
+    const uint32_t triangles = static_cast<uint32_t>(corners.size() / 3);
+
+    struct TriangleSpan {
+        float zMin, zMax;
+        uint32_t triangle;
+        bool operator<(const TriangleSpan& other) const {
+            return zMin < other.zMin || (zMin == other.zMin && triangle < other.triangle);
+        }
+    };
+
+    std::vector<TriangleSpan> spans(triangles);
+    parallelFor(triangles, [&](size_t, size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            float z0 = vertices[corners[t * 3]].z;
+            float z1 = vertices[corners[t * 3 + 1]].z;
+            float z2 = vertices[corners[t * 3 + 2]].z;
+            spans[t] = {std::min({z0, z1, z2}), std::max({z0, z1, z2}), static_cast<uint32_t>(t)};
+        }
+    }, 4096);
+    parallelSort(spans);
+
+    std::vector<uint32_t> layers(heights.size());
+    for (uint32_t i = 0; i < layers.size(); ++i) {
+        layers[i] = i;
+    }
+    std::sort(layers.begin(), layers.end(), [&](uint32_t a, uint32_t b) { return heights[a] < heights[b]; });
+
+    struct Segment {
+        uint64_t fromEdge, toEdge;
+        Vertex from, to;
+    };
+
+    auto edgeKey = [](uint64_t a, uint64_t b) { return a < b ? (a << 32 | b) : (b << 32 | a); };
+
+    parallelFor(layers.size(), [&](size_t, size_t begin, size_t end) {
+        std::vector<uint32_t> active;
+        std::vector<Segment> segments;
+        std::vector<bool> hasPredecessor;
+        std::vector<bool> visited;
+        std::unordered_map<uint64_t, uint32_t> startingAt;
+
+        // Triangles starting below the first layer of the band but still spanning it
+        const float bandStart = heights[layers[begin]];
+        size_t nextSpan = 0;
+        while (nextSpan < spans.size() && spans[nextSpan].zMin <= bandStart) {
+            if (spans[nextSpan].zMax >= bandStart) {
+                active.push_back(nextSpan);
+            }
+            ++nextSpan;
+        }
+
+        for (size_t l = begin; l < end; ++l) {
+            const float h = heights[layers[l]];
+
+            while (nextSpan < spans.size() && spans[nextSpan].zMin <= h) {
+                active.push_back(nextSpan++);
+            }
+            active.erase(std::remove_if(active.begin(), active.end(),
+                                        [&](uint32_t s) { return spans[s].zMax < h; }),
+                         active.end());
+
+            segments.clear();
+            for (uint32_t s : active) {
+                const uint32_t* tri = &corners[spans[s].triangle * 3];
+                Segment segment{};
+                bool crosses = false;
+
+                for (int i = 0; i < 3; ++i) {
+                    const uint32_t a = tri[i];
+                    const uint32_t b = tri[(i + 1) % 3];
+                    const Vertex& va = vertices[a];
+                    const Vertex& vb = vertices[b];
+                    const bool aAbove = va.z >= h;
+                    if (aAbove == (vb.z >= h)) {
+                        continue;
+                    }
+                    crosses = true;
+
+                    // interpolate from the endpoint below the plane so shared edges give the same point,
+                    // a vertex on the plane is taken as is so every edge reaching it gives exactly that point
+                    const Vertex& below = aAbove ? vb : va;
+                    const Vertex& above = aAbove ? va : vb;
+                    Vertex point = {above.x, above.y, h};
+                    if (above.z != h) {
+                        float t = (h - below.z) / (above.z - below.z);
+                        point = {below.x + t * (above.x - below.x), below.y + t * (above.y - below.y), h};
+                    }
+
+                    // going down the segment starts on this edge, going up it ends on it
+                    if (aAbove) {
+                        segment.fromEdge = edgeKey(a, b);
+                        segment.from = point;
+                    } else {
+                        segment.toEdge = edgeKey(a, b);
+                        segment.to = point;
+                    }
+                }
+
+                if (crosses) {
+                    segments.push_back(segment);
+                }
+            }
+
+            // Chain segments: the end edge of a segment is the start edge of the following one
+            startingAt.clear();
+            startingAt.reserve(segments.size());
+            for (uint32_t i = 0; i < segments.size(); ++i) {
+                startingAt.emplace(segments[i].fromEdge, i);
+            }
+
+            hasPredecessor.assign(segments.size(), false);
+            for (const auto& segment : segments) {
+                auto it = startingAt.find(segment.toEdge);
+                if (it != startingAt.end()) {
+                    hasPredecessor[it->second] = true;
+                }
+            }
+
+            std::vector<Contour>& contours = result[layers[l]];
+            visited.assign(segments.size(), false);
+
+            // consecutive duplicates appear when the plane goes exactly through a vertex
+            auto addPoint = [](Contour& contour, const Vertex& point) {
+                if (contour.points.empty() || point.x != contour.points.back().x || point.y != contour.points.back().y) {
+                    contour.points.push_back(point);
+                }
+            };
+
+            auto follow = [&](uint32_t first) {
+                Contour contour;
+                uint32_t current = first;
+                while (true) {
+                    visited[current] = true;
+                    addPoint(contour, segments[current].from);
+
+                    auto it = startingAt.find(segments[current].toEdge);
+                    if (it == startingAt.end()) {
+                        addPoint(contour, segments[current].to);
+                        contour.closed = false;
+                        break;
+                    }
+                    current = it->second;
+                    if (current == first) {
+                        break;
+                    }
+                    if (visited[current]) {
+                        // ran into an already followed chain, only possible around non-manifold edges
+                        addPoint(contour, segments[current].from);
+                        contour.closed = false;
+                        break;
+                    }
+                }
+                if (contour.closed && contour.points.size() > 1
+                    && contour.points.front().x == contour.points.back().x
+                    && contour.points.front().y == contour.points.back().y) {
+                    contour.points.pop_back();
+                }
+
+                // a plane going exactly through a peak or a ridge leaves contours with no extent
+                if (!contour.closed) {
+                    if (contour.points.size() >= 2) {
+                        contours.push_back(std::move(contour));
+                    }
+                    return;
+                }
+                float area = 0.0f;
+                for (size_t i = 0; i < contour.points.size(); ++i) {
+                    const Vertex& a = contour.points[i];
+                    const Vertex& b = contour.points[(i + 1) % contour.points.size()];
+                    area += a.x * b.y - b.x * a.y;
+                }
+                if (contour.points.size() >= 3 && area != 0.0f) {
+                    contours.push_back(std::move(contour));
+                }
+            };
+
+            // Open chains first so they are followed from their head
+            for (uint32_t i = 0; i < segments.size(); ++i) {
+                if (!hasPredecessor[i] && !visited[i]) {
+                    follow(i);
+                }
+            }
+            for (uint32_t i = 0; i < segments.size(); ++i) {
+                if (!visited[i]) {
+                    follow(i);
+                }
+            }
+        }
+    });
+
+    return result;
+}
+
+/*
+    Topology is not kept in the model, this builds it on demand from the current faces.
+    Half-edge h of the result starts at vertex origin(h), 0-based, the same vertex as vertices[origin(h)].
+*/
+inline HalfEdgeMesh Model<FileType::OBJ>::buildHalfEdgeMesh() const {
+    std::vector<uint32_t> faceOffsets(faces.size() + 1);
+    faceOffsets[0] = 0;
+    for (size_t f = 0; f < faces.size(); ++f) {
+        uint64_t offset = static_cast<uint64_t>(faceOffsets[f]) + faces[f].vertices.size();
+        if (offset >= HalfEdgeMesh::NON_MANIFOLD) {
+            throw std::runtime_error("Mesh too large for 32-bit half-edge indices");
+        }
+        faceOffsets[f + 1] = static_cast<uint32_t>(offset);
+    }
+
+    std::vector<uint32_t> origins(faceOffsets.back());
+    parallelFor(faces.size(), [&](size_t, size_t begin, size_t end) {
+        for (size_t f = begin; f < end; ++f) {
+            uint32_t h = faceOffsets[f];
+            for (const auto& faceVertex : faces[f].vertices) {
+                origins[h++] = faceVertex.vertexIndex - 1;
+            }
+        }
+    }, 4096);
+
+    return HalfEdgeMesh(vertices.size(), std::move(faceOffsets), std::move(origins));
+}
+
 } // namespace FAConverter
 
 #endif // MODEL_OBJ_HPP
\ No newline at end of file
@@ -0,0 +1,150 @@
+/**
+ * @file Parallel.hpp
+ * @author F. Abrignani (federignoli@hotmail.it)
+ * @brief Minimal threading helpers for the FAConverter library.
+ * @version 0.1
+ * @date 2024-07-06
+ * @private
+ * @copyright Copyright (c) 2024 Federico Abrignani (federignoli@hotmail.it).
+ *
+ */
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace FAConverter {
+
+inline std::atomic<size_t>& workerCountSetting() {
+    static std::atomic<size_t> count = 0;
+    return count;
+}
+
+/*
+    Process-wide number of workers used by every parallel algorithm of the library,
+    0 (the default) uses std::thread::hardware_concurrency().
+    It can be changed while other threads are inside the library, a running call may then
+    use either value for its remaining steps.
+*/
+inline void setWorkerCount(size_t count) {
+    workerCountSetting().store(count, std::memory_order_relaxed);
+}
+
+inline size_t workerCount() {
+    size_t count = workerCountSetting().load(std::memory_order_relaxed);
+    if (count != 0) {
+        return count;
+    }
+    size_t hw = std::thread::hardware_concurrency();
+    return hw == 0 ? 1 : hw;
+}
+
+/*
+    Splits [0, count) in at most maxWorkers (workerCount() when 0) contiguous chunks and calls
+    f(worker, begin, end) for each of them, one chunk per thread.
+    The calling thread runs the first chunk itself so a single chunk never spawns a thread.
+    Every started thread is joined before returning; an exception thrown by f, or by the
+    creation of a thread, is rethrown on the calling thread.
+*/
+template<typename F>
+void parallelFor(size_t count, F&& f, size_t minChunk = 1, size_t maxWorkers = 0) {
+    if (count == 0) {
+        return;
+    }
+
+    size_t workers = std::min(maxWorkers == 0 ? workerCount() : maxWorkers, (count + minChunk - 1) / minChunk);
+    size_t chunk = (count + workers - 1) / workers;
+
+    std::vector<std::exception_ptr> errors(workers);
+    auto run = [&f, &errors](size_t worker, size_t begin, size_t end) {
+        try {
+            f(worker, begin, end);
+        } catch (...) {
+            errors[worker] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    std::exception_ptr spawnError;
+    try {
+        threads.reserve(workers - 1);
+        for (size_t w = 1; w < workers; ++w) {
+            size_t begin = w * chunk;
+            size_t end = std::min(count, begin + chunk);
+            if (begin >= end) {
+                break;
+            }
+            threads.emplace_back(run, w, begin, end);
+        }
+    } catch (...) {
+        spawnError = std::current_exception();
+    }
+
+    if (!spawnError) {
+        run(0, 0, std::min(count, chunk));
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (spawnError) {
+        std::rethrow_exception(spawnError);
+    }
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+/*
+    Sorts the chunks handed to each worker independently, then merges neighbouring runs
+    pairwise in parallel until a single sorted run is left.
+*/
+template<typename T, typename Compare = std::less<T>>
+void parallelSort(std::vector<T>& values, Compare compare = Compare{}) {
+    size_t parts = std::min(workerCount(), values.size());
+    if (parts <= 1) {
+        std::sort(values.begin(), values.end(), compare);
+        return;
+    }
+
+    std::vector<size_t> bounds(parts + 1);
+    for (size_t p = 0; p <= parts; ++p) {
+        bounds[p] = values.size() * p / parts;
+    }
+
+    parallelFor(parts, [&](size_t, size_t begin, size_t end) {
+        for (size_t p = begin; p < end; ++p) {
+            std::sort(values.begin() + bounds[p], values.begin() + bounds[p + 1], compare);
+        }
+    });
+
+    for (size_t width = 1; width < parts; width *= 2) {
+        size_t merges = (parts + 2 * width - 1) / (2 * width);
+        parallelFor(merges, [&](size_t, size_t begin, size_t end) {
+            for (size_t m = begin; m < end; ++m) {
+                size_t first = m * 2 * width;
+                size_t middle = std::min(parts, first + width);
+                size_t last = std::min(parts, first + 2 * width);
+                if (middle < last) {
+                    std::inplace_merge(values.begin() + bounds[first],
+                                       values.begin() + bounds[middle],
+                                       values.begin() + bounds[last], compare);
+                }
+            }
+        });
+    }
+}
+
+} // namespace FAConverter
+
+#endif // PARALLEL_HPP
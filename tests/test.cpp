@@ -10,6 +10,8 @@
  */
 #include <gtest/gtest.h>
 #include <FAConverter.hpp>
+#include <atomic>
+#include <cstring>
 
 const std::string OBJ_FILE_PATH = ""; // add a path to some obj file to test conversion and transformations on
 
@@ -112,6 +114,430 @@ TEST(OBJModel, CalculateVolume) {
     ASSERT_TRUE(false); // TODO
 }
 
+TEST(OBJModel, WriteInstancedSTL) {
+    /*
+    This test is used to test the writeInstanced method of the OBJ model.
+    Every instance should be written after the previous one with its own transform applied.
+    */
+    FAConverter::Model<FAConverter::FileType::OBJ> objModel;
+    objModel.read("cube.obj");
+
+    std::vector<FAConverter::Matrix4x4> instances = {
+        FAConverter::Matrix4x4::identity(),
+        FAConverter::Matrix4x4::translation(2.0f, 0.0f, 0.0f),
+        FAConverter::Matrix4x4::translation(0.0f, 0.0f, 5.0f) * FAConverter::Matrix4x4::scaling(2.0f, 2.0f, 2.0f)
+    };
+    objModel.writeInstanced<FAConverter::FileType::STL>("instanced_example.stl", instances);
+
+    // the same file must come out when the blocks are split over several workers
+    FAConverter::setWorkerCount(7);
+    objModel.writeInstanced<FAConverter::FileType::STL>("instanced_example_parallel.stl", instances);
+    FAConverter::setWorkerCount(0);
+    {
+        std::ifstream serial("instanced_example.stl", std::ios::binary);
+        std::ifstream parallel("instanced_example_parallel.stl", std::ios::binary);
+        std::string serialBytes((std::istreambuf_iterator<char>(serial)), std::istreambuf_iterator<char>());
+        std::string parallelBytes((std::istreambuf_iterator<char>(parallel)), std::istreambuf_iterator<char>());
+        ASSERT_EQ(serialBytes.size(), 80u + 4u + 36u * 50u);
+        ASSERT_EQ(serialBytes, parallelBytes);
+    }
+
+    std::ifstream file("instanced_example.stl", std::ios::binary);
+    ASSERT_TRUE(file.is_open());
+
+    file.seekg(80);
+    uint32_t numTriangles = 0;
+    file.read(reinterpret_cast<char*>(&numTriangles), sizeof(numTriangles));
+    ASSERT_EQ(numTriangles, 36u); // 6 quads -> 12 triangles per instance
+
+    std::vector<std::array<float, 12>> records(numTriangles);
+    for (auto& record : records) {
+        file.read(reinterpret_cast<char*>(record.data()), sizeof(float) * 12);
+        file.seekg(sizeof(uint16_t), std::ios::cur);
+    }
+    ASSERT_TRUE(file.good());
+
+    for (size_t t = 0; t < 12; ++t) {
+        for (size_t c = 3; c < 12; c += 3) {
+            ASSERT_FLOAT_EQ(records[t + 12][c], records[t][c] + 2.0f);
+            ASSERT_FLOAT_EQ(records[t + 12][c + 1], records[t][c + 1]);
+            ASSERT_FLOAT_EQ(records[t + 24][c + 2], records[t][c + 2] * 2.0f + 5.0f);
+        }
+        // translation and uniform scaling do not change the normal
+        for (size_t c = 0; c < 3; ++c) {
+            ASSERT_NEAR(records[t + 12][c], records[t][c], 1e-6f);
+            ASSERT_NEAR(records[t + 24][c], records[t][c], 1e-6f);
+        }
+    }
+}
+
+TEST(OBJModel, WriteInstancedManyCopies) {
+    /*
+    This test is used to test writeInstanced with many copies of a small model,
+    where a single block holds several instances and block boundaries fall inside an instance.
+    */
+    FAConverter::Model<FAConverter::FileType::OBJ> objModel;
+    objModel.read("cube.obj");
+
+    std::vector<FAConverter::Matrix4x4> instances;
+    for (int i = 0; i < 1000; ++i) {
+        instances.push_back(FAConverter::Matrix4x4::translation(static_cast<float>(i), 0.0f, 0.0f));
+    }
+    objModel.writeInstanced<FAConverter::FileType::STL>("instanced_many.stl", instances);
+
+    std::ifstream file("instanced_many.stl", std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(bytes.size(), 80u + 4u + 1000u * 12u * 50u);
+
+    auto coordinate = [&](size_t triangle, size_t index) {
+        float value;
+        std::memcpy(&value, bytes.data() + 84 + triangle * 50 + index * sizeof(float), sizeof(float));
+        return value;
+    };
+    for (size_t i = 0; i < 1000; ++i) {
+        for (size_t t = 0; t < 12; ++t) {
+            for (size_t c = 3; c < 12; c += 3) {
+                ASSERT_FLOAT_EQ(coordinate(i * 12 + t, c), coordinate(t, c) + static_cast<float>(i));
+                ASSERT_FLOAT_EQ(coordinate(i * 12 + t, c + 1), coordinate(t, c + 1));
+                ASSERT_FLOAT_EQ(coordinate(i * 12 + t, c + 2), coordinate(t, c + 2));
+            }
+        }
+    }
+}
+
+TEST(OBJModel, HalfEdgeMeshClosed) {
+    /*
+    This test is used to test the half-edge adjacency on a closed and consistently oriented tetrahedron.
+    */
+    {
+        std::ofstream file("tetrahedron.obj");
+        file << "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 0 1\n"
+             << "f 1 3 2\nf 1 2 4\nf 2 3 4\nf 3 1 4\n";
+    }
+    FAConverter::Model<FAConverter::FileType::OBJ> objModel;
+    objModel.read("tetrahedron.obj");
+
+    FAConverter::HalfEdgeMesh mesh = objModel.buildHalfEdgeMesh();
+
+    ASSERT_EQ(mesh.halfEdgeCount(), 12u);
+    ASSERT_TRUE(mesh.isWatertight());
+    ASSERT_TRUE(mesh.boundaryLoops().empty());
+
+    for (uint32_t h = 0; h < mesh.halfEdgeCount(); ++h) {
+        ASSERT_TRUE(mesh.hasOpposite(h));
+        uint32_t o = mesh.opposite(h);
+        ASSERT_EQ(mesh.opposite(o), h);
+        ASSERT_EQ(mesh.origin(o), mesh.target(h));
+        ASSERT_EQ(mesh.target(o), mesh.origin(h));
+    }
+
+    for (uint32_t v = 0; v < mesh.vertexCount(); ++v) {
+        auto ring = mesh.vertexOneRing(v);
+        std::sort(ring.begin(), ring.end());
+        std::vector<uint32_t> expected;
+        for (uint32_t u = 0; u < mesh.vertexCount(); ++u) {
+            if (u != v) {
+                expected.push_back(u);
+            }
+        }
+        ASSERT_EQ(ring, expected);
+    }
+}
+
+TEST(OBJModel, HalfEdgeMeshBoundaryAndNonManifold) {
+    /*
+    This test is used to test boundary loops and non-manifold edges detection.
+    The first file is a 2x2 grid of quads, the second has three triangles sharing the same edge.
+    */
+    {
+        std::ofstream file("grid.obj");
+        for (int y = 0; y < 3; ++y) {
+            for (int x = 0; x < 3; ++x) {
+                file << "v " << x << " " << y << " 0\n";
+            }
+        }
+        file << "f 1 2 5 4\nf 2 3 6 5\nf 4 5 8 7\nf 5 6 9 8\n";
+    }
+    FAConverter::Model<FAConverter::FileType::OBJ> grid;
+    grid.read("grid.obj");
+
+    FAConverter::HalfEdgeMesh mesh = grid.buildHalfEdgeMesh();
+
+    ASSERT_FALSE(mesh.isWatertight());
+    ASSERT_TRUE(mesh.nonManifoldEdges().empty());
+    ASSERT_EQ(mesh.boundaryHalfEdgeCount(), 8u);
+
+    auto loops = mesh.boundaryLoops();
+    ASSERT_EQ(loops.size(), 1u);
+    ASSERT_EQ(loops[0].size(), 8u);
+    for (size_t i = 0; i < loops[0].size(); ++i) {
+        ASSERT_EQ(mesh.target(loops[0][i]), mesh.origin(loops[0][(i + 1) % loops[0].size()]));
+    }
+
+    auto center = mesh.vertexOneRing(4);
+    std::sort(center.begin(), center.end());
+    ASSERT_EQ(center, (std::vector<uint32_t>{1, 3, 5, 7}));
+
+    auto side = mesh.vertexOneRing(1);
+    std::sort(side.begin(), side.end());
+    ASSERT_EQ(side, (std::vector<uint32_t>{0, 2, 4}));
+
+    auto corner = mesh.vertexOneRing(0);
+    std::sort(corner.begin(), corner.end());
+    ASSERT_EQ(corner, (std::vector<uint32_t>{1, 3}));
+
+    {
+        std::ofstream file("fin.obj");
+        file << "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 0 -1 0\nv 0 0 1\n"
+             << "f 1 2 3\nf 2 1 4\nf 1 2 5\n";
+    }
+    FAConverter::Model<FAConverter::FileType::OBJ> fin;
+    fin.read("fin.obj");
+
+    FAConverter::HalfEdgeMesh finMesh = fin.buildHalfEdgeMesh();
+    ASSERT_EQ(finMesh.nonManifoldEdges().size(), 1u);
+    uint32_t edge = finMesh.nonManifoldEdges()[0];
+    ASSERT_EQ(std::min(finMesh.origin(edge), finMesh.target(edge)), 0u);
+    ASSERT_EQ(std::max(finMesh.origin(edge), finMesh.target(edge)), 1u);
+
+    // a 2-vertex face uses its only edge twice, it must not look like a closed surface
+    {
+        std::ofstream file("segment.obj");
+        file << "v 0 0 0\nv 1 0 0\nf 1 2\n";
+    }
+    FAConverter::Model<FAConverter::FileType::OBJ> segment;
+    segment.read("segment.obj");
+
+    FAConverter::HalfEdgeMesh segmentMesh = segment.buildHalfEdgeMesh();
+    ASSERT_EQ(segmentMesh.halfEdgeCount(), 2u);
+    ASSERT_FALSE(segmentMesh.isWatertight());
+    ASSERT_EQ(segmentMesh.nonManifoldEdges().size(), 1u);
+    ASSERT_FALSE(segmentMesh.hasOpposite(0));
+}
+
+TEST(OBJModel, Slice) {
+    /*
+    This test is used to test the slice method of the OBJ model.
+    The cucube.obj file has an outer cube facing out and an inner cube facing in,
+    so a slice through both must give a counterclockwise outer contour and a clockwise hole.
+    */
+    FAConverter::Model<FAConverter::FileType::OBJ> objModel;
+    objModel.read("cucube.obj");
+
+    auto signedArea = [](const FAConverter::Contour& contour) {
+        float area = 0.0f;
+        for (size_t i = 0; i < contour.points.size(); ++i) {
+            const auto& a = contour.points[i];
+            const auto& b = contour.points[(i + 1) % contour.points.size()];
+            area += a.x * b.y - b.x * a.y;
+        }
+        return area / 2.0f;
+    };
+
+    // unsorted on purpose, results must follow the order of the heights
+    std::vector<float> heights = {1.0f, 0.0f, 0.25f, -0.75f};
+    auto layers = objModel.slice(heights);
+
+    ASSERT_EQ(layers.size(), heights.size());
+    ASSERT_TRUE(layers[0].empty());
+    ASSERT_TRUE(layers[3].empty());
+
+    ASSERT_EQ(layers[1].size(), 2u);
+    std::vector<float> areas;
+    for (const auto& contour : layers[1]) {
+        ASSERT_TRUE(contour.closed);
+        for (const auto& point : contour.points) {
+            ASSERT_FLOAT_EQ(point.z, 0.0f);
+        }
+        areas.push_back(signedArea(contour));
+    }
+    std::sort(areas.begin(), areas.end());
+    ASSERT_NEAR(areas[0], -0.01f, 1e-5f);
+    ASSERT_NEAR(areas[1], 1.0f, 1e-5f);
+
+    ASSERT_EQ(layers[2].size(), 1u);
+    ASSERT_TRUE(layers[2][0].closed);
+    ASSERT_NEAR(signedArea(layers[2][0]), 1.0f, 1e-5f);
+}
+
+TEST(OBJModel, SliceAtVertexHeight) {
+    /*
+    This test is used to test the slice method when a plane goes exactly through vertices.
+    A vertex with z == height counts as above the plane: slicing a cube at its top gives the full square,
+    at its bottom nothing, and slicing a pyramid at its apex must not give a degenerate contour.
+    */
+    FAConverter::Model<FAConverter::FileType::OBJ> objModel;
+    objModel.read("cucube.obj");
+
+    auto layers = objModel.slice({0.5f, -0.5f, 0.05f});
+
+    ASSERT_EQ(layers[0].size(), 1u);
+    ASSERT_TRUE(layers[0][0].closed);
+    ASSERT_EQ(layers[0][0].points.size(), 4u);
+    for (const auto& point : layers[0][0].points) {
+        ASSERT_FLOAT_EQ(std::abs(point.x), 0.5f);
+        ASSERT_FLOAT_EQ(std::abs(point.y), 0.5f);
+    }
+
+    ASSERT_TRUE(layers[1].empty());
+
+    // top of the inner cube: the outer square and the inner square as a hole
+    ASSERT_EQ(layers[2].size(), 2u);
+    std::vector<float> areas;
+    for (const auto& contour : layers[2]) {
+        ASSERT_TRUE(contour.closed);
+        float area = 0.0f;
+        for (size_t i = 0; i < contour.points.size(); ++i) {
+            const auto& a = contour.points[i];
+            const auto& b = contour.points[(i + 1) % contour.points.size()];
+            area += a.x * b.y - b.x * a.y;
+        }
+        areas.push_back(area / 2.0f);
+    }
+    std::sort(areas.begin(), areas.end());
+    ASSERT_NEAR(areas[0], -0.01f, 1e-5f);
+    ASSERT_NEAR(areas[1], 1.0f, 1e-5f);
+
+    {
+        std::ofstream file("pyramid.obj");
+        file << "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0.5 0.5 1\n"
+             << "f 1 4 3 2\nf 1 2 5\nf 2 3 5\nf 3 4 5\nf 4 1 5\n";
+    }
+    FAConverter::Model<FAConverter::FileType::OBJ> pyramid;
+    pyramid.read("pyramid.obj");
+
+    auto apex = pyramid.slice({1.0f, 0.5f});
+    ASSERT_TRUE(apex[0].empty());
+    ASSERT_EQ(apex[1].size(), 1u);
+    ASSERT_EQ(apex[1][0].points.size(), 4u);
+
+    // coordinates that are not exact in binary, every edge reaching the apex must give the same point
+    {
+        std::ofstream file("skewed_pyramid.obj");
+        file << "v 0.203606129 -2.03762889 0\nv 1.57360613 -2.03762889 0\nv 1.57360613 -0.927628875 0\n"
+             << "v 0.203606129 -0.927628875 0\nv -0.865768909 2.32384825 0.176033854\n"
+             << "f 1 4 3 2\nf 1 2 5\nf 2 3 5\nf 3 4 5\nf 4 1 5\n";
+    }
+    FAConverter::Model<FAConverter::FileType::OBJ> skewed;
+    skewed.read("skewed_pyramid.obj");
+
+    auto skewedApex = skewed.slice({0.176033854f, 0.0f, 0.1f});
+    ASSERT_TRUE(skewedApex[0].empty());
+    ASSERT_TRUE(skewedApex[1].empty());
+    ASSERT_EQ(skewedApex[2].size(), 1u);
+    ASSERT_EQ(skewedApex[2][0].points.size(), 4u);
+}
+
+// 64x64 quads with a wavy height, large enough for the parallel algorithms to be split in several chunks
+void writeWavyGrid(const std::string& filename) {
+    std::ofstream file(filename);
+    const int size = 64;
+    for (int y = 0; y <= size; ++y) {
+        for (int x = 0; x <= size; ++x) {
+            file << "v " << x << " " << y << " " << std::sin(x * 0.3f) * std::cos(y * 0.2f) << "\n";
+        }
+    }
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            int a = y * (size + 1) + x + 1;
+            file << "f " << a << " " << a + 1 << " " << a + size + 2 << " " << a + size + 1 << "\n";
+        }
+    }
+}
+
+TEST(OBJModel, HalfEdgeMeshParallelMatchesSerial) {
+    /*
+    This test is used to check that the half-edge build gives the same result with several workers.
+    On a single core machine nothing would run in parallel, so the worker count is forced.
+    The grid is large enough for the key sort to merge several runs and for the run scan
+    to be split in several chunks.
+    */
+    writeWavyGrid("wavy_grid.obj");
+    FAConverter::Model<FAConverter::FileType::OBJ> grid;
+    grid.read("wavy_grid.obj");
+
+    auto serialMesh = grid.buildHalfEdgeMesh();
+    FAConverter::setWorkerCount(7);
+    auto parallelMesh = grid.buildHalfEdgeMesh();
+    FAConverter::setWorkerCount(0);
+
+    ASSERT_EQ(parallelMesh.halfEdgeCount(), serialMesh.halfEdgeCount());
+    ASSERT_EQ(parallelMesh.boundaryHalfEdgeCount(), serialMesh.boundaryHalfEdgeCount());
+    ASSERT_EQ(serialMesh.boundaryHalfEdgeCount(), 4u * 64u);
+    ASSERT_TRUE(parallelMesh.nonManifoldEdges().empty());
+    for (uint32_t h = 0; h < serialMesh.halfEdgeCount(); ++h) {
+        ASSERT_EQ(parallelMesh.opposite(h), serialMesh.opposite(h));
+    }
+}
+
+TEST(OBJModel, ParallelMatchesSerial) {
+    /*
+    This test is used to check that splitting the slice heights in several layer bands gives the same
+    contours as a single band. On a single core machine nothing would run in parallel, so the worker count is forced.
+    */
+    writeWavyGrid("wavy_grid.obj");
+    FAConverter::Model<FAConverter::FileType::OBJ> grid;
+    grid.read("wavy_grid.obj");
+    FAConverter::Model<FAConverter::FileType::OBJ> cucube;
+    cucube.read("cucube.obj");
+
+    std::vector<float> heights;
+    for (int i = 0; i < 64; ++i) {
+        heights.push_back(-0.6f + 1.2f * i / 63.0f);
+    }
+
+    auto serialGridSlices = grid.slice(heights);
+    auto serialCubeSlices = cucube.slice(heights);
+
+    FAConverter::setWorkerCount(7);
+    auto parallelGridSlices = grid.slice(heights);
+    auto parallelCubeSlices = cucube.slice(heights);
+    FAConverter::setWorkerCount(0);
+
+    auto sameLayers = [](const std::vector<std::vector<FAConverter::Contour>>& a,
+                         const std::vector<std::vector<FAConverter::Contour>>& b) {
+        ASSERT_EQ(a.size(), b.size());
+        for (size_t l = 0; l < a.size(); ++l) {
+            ASSERT_EQ(a[l].size(), b[l].size());
+            for (size_t c = 0; c < a[l].size(); ++c) {
+                ASSERT_EQ(a[l][c].closed, b[l][c].closed);
+                ASSERT_EQ(a[l][c].points.size(), b[l][c].points.size());
+                for (size_t p = 0; p < a[l][c].points.size(); ++p) {
+                    ASSERT_EQ(a[l][c].points[p].x, b[l][c].points[p].x);
+                    ASSERT_EQ(a[l][c].points[p].y, b[l][c].points[p].y);
+                }
+            }
+        }
+    };
+    // a failed assertion only leaves the lambda, ASSERT_NO_FATAL_FAILURE stops the test as well
+    ASSERT_NO_FATAL_FAILURE(sameLayers(serialGridSlices, parallelGridSlices));
+    ASSERT_NO_FATAL_FAILURE(sameLayers(serialCubeSlices, parallelCubeSlices));
+
+    size_t cubeContours = 0;
+    for (const auto& layer : serialCubeSlices) {
+        cubeContours += layer.size();
+    }
+    ASSERT_GT(cubeContours, 0u);
+}
+
+TEST(Parallel, ExceptionsReachTheCaller) {
+    /*
+    This test is used to check that an exception thrown inside a worker is rethrown by parallelFor
+    once every thread has been joined, instead of terminating the program.
+    */
+    FAConverter::setWorkerCount(4);
+    std::atomic<size_t> visited = 0;
+    auto throwing = [&](size_t, size_t begin, size_t end) {
+        visited += end - begin;
+        if (begin == 0 || end == 100) {
+            throw std::runtime_error("worker failed");
+        }
+    };
+    ASSERT_THROW(FAConverter::parallelFor(100, throwing), std::runtime_error);
+    FAConverter::setWorkerCount(0);
+    ASSERT_EQ(visited.load(), 100u);
+}
+
 int main(int argc, char* argv[]) {
 
     testing::InitGoogleTest(&argc, argv);